@@ -0,0 +1,38 @@
+// Bytes per registered flag, from Parser::memory_usage(), for flag tables of
+// growing size with small and large actions
+#define JARGS_IMPLEMENTATION
+#include "jargs.hpp"
+
+#include <array>
+#include <iomanip>
+
+template <typename Action>
+static void report(const char *kind, size_t count, Action action)
+{
+    // Names must outlive the parser
+    std::deque<std::string> names;
+    jargs::Parser parser;
+    for (size_t i = 0; i < count; i++)
+        parser.add(names.emplace_back("flag-" + std::to_string(i)), "Description", action);
+
+    auto m = parser.memory_usage();
+    std::cout << std::setw(6) << kind << std::setw(8) << count
+              << std::setw(10) << double(m.flags) / count
+              << std::setw(10) << double(m.callables) / count
+              << std::setw(10) << double(m.index) / count
+              << std::setw(10) << double(m.total()) / count << '\n';
+}
+
+int main()
+{
+    std::cout << "sizeof(Flag) = " << sizeof(jargs::Flag) << ", bytes per flag:\n"
+              << std::setw(6) << "action" << std::setw(8) << "flags" << std::setw(10) << "table"
+              << std::setw(10) << "callables" << std::setw(10) << "index" << std::setw(10) << "total" << '\n';
+
+    int counter = 0;
+    std::array<char, 64> payload = {};
+    for (size_t count : {10, 100, 1000, 10000}) {
+        report("small", count, [&counter]() { counter++; });
+        report("large", count, [&counter, payload]() { counter += payload[0]; });
+    }
+}
@@ -0,0 +1,53 @@
+// Read throughput of Replicated<T> against a single shared std::atomic<T>,
+// with one reader thread per CPU
+#define JARGS_NUMA
+#define JARGS_IMPLEMENTATION
+#include "jargs.hpp"
+
+#include <chrono>
+#include <thread>
+
+template <typename Read>
+static double reads_per_second(unsigned threads, Read read)
+{
+    using namespace std::chrono;
+    constexpr auto run_time = milliseconds(500);
+
+    std::atomic<bool> stop = false;
+    std::atomic<unsigned long long> total = 0;
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < threads; t++) {
+        readers.emplace_back([&]() {
+            // Atomic loads are not optimized away
+            unsigned long long n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 1024; i++)
+                    read();
+                n += 1024;
+            }
+            total += n;
+        });
+    }
+
+    auto start = steady_clock::now();
+    std::this_thread::sleep_for(run_time);
+    stop = true;
+    for (auto &r : readers)
+        r.join();
+    return total / duration<double>(steady_clock::now() - start).count();
+}
+
+int main()
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << jargs::numa_nodes() << " NUMA node(s), " << threads << " reader thread(s)\n";
+
+    jargs::Replicated<long> replicated(1);
+    alignas(64) std::atomic<long> shared = 1;
+
+    std::cout << "Replicated<long>    " << reads_per_second(threads, [&]() { return replicated.get(); }) / 1e6
+              << " M reads/s\n";
+    std::cout << "std::atomic<long>   " << reads_per_second(threads, [&]() {
+        return shared.load(std::memory_order_acquire);
+    }) / 1e6 << " M reads/s\n";
+}
@@ -71,109 +71,1888 @@
 #ifndef JARGS_HPP
 #define JARGS_HPP
 
+#include <atomic>
+#include <concepts>
+#include <deque>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <cstdint>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#ifdef JARGS_NET
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
 namespace jargs
 {
 
 struct Flag {
-    char short_name;
     std::string_view long_name;
     std::string_view description;
+    // Callables are moved in and owned by value lest we segfault; move-only
+    // ones are accepted
+    std::move_only_function<void(std::string_view optarg)> action;
+    // Kept together at the end to avoid padding
+    char short_name;
     bool expects_value;
-    // Functions are copied by value lest we segfault
-    std::function<void(std::string_view optarg)> action;
+    // Left out of the help page
+    bool hidden = false;
+    // Bytes allocated for the callable, including callables it wraps; for
+    // Parser::memory_usage()
+    uint32_t callable_allocated;
 
     // With arg
 
     // short, long
-    Flag(char c, std::string_view s, std::string_view desc,
-         std::function<void(std::string_view optarg)> f)
-                 : short_name(c), long_name(s), description(desc)
-                 , expects_value(true), action(f)
+    template <typename F> requires std::invocable<F &, std::string_view>
+    Flag(char c, std::string_view s, std::string_view desc, F &&f)
+                 : long_name(s), description(desc), action(std::forward<F>(f))
+                 , short_name(c), expects_value(true), callable_allocated(allocated<std::decay_t<F>>())
     {}
     // long
-    Flag(std::string_view s, std::string_view desc,
-         std::function<void(std::string_view optarg)> f)
-                : Flag('\0', s, desc, f)
+    template <typename F> requires std::invocable<F &, std::string_view>
+    Flag(std::string_view s, std::string_view desc, F &&f)
+                : Flag('\0', s, desc, std::forward<F>(f))
     {}
     // short
-    Flag(char c, std::string_view desc,
-         std::function<void(std::string_view optarg)> f)
-                : Flag(c, std::string_view(), desc, f)
+    template <typename F> requires std::invocable<F &, std::string_view>
+    Flag(char c, std::string_view desc, F &&f)
+                : Flag(c, std::string_view(), desc, std::forward<F>(f))
     {}
 
     // Without arg
 
     // short, long
-    Flag(char c, std::string_view s, std::string_view desc, std::function<void()> f)
-                 : short_name(c), long_name(s), description(desc)
-                 , expects_value(false), action([f](std::string_view optarg){ (void)optarg; f(); })
+    template <typename F> requires (std::invocable<F &> && !std::invocable<F &, std::string_view>)
+    Flag(char c, std::string_view s, std::string_view desc, F &&f)
+                 : long_name(s), description(desc)
+                 , action(std::in_place_type<IgnoreArg<std::decay_t<F>>>, std::forward<F>(f))
+                 , short_name(c), expects_value(false), callable_allocated(allocated<IgnoreArg<std::decay_t<F>>>())
     {}
     // long
-    Flag(std::string_view s, std::string_view desc, std::function<void()> f)
-                 : Flag('\0', s, desc, f)
+    template <typename F> requires (std::invocable<F &> && !std::invocable<F &, std::string_view>)
+    Flag(std::string_view s, std::string_view desc, F &&f)
+                 : Flag('\0', s, desc, std::forward<F>(f))
     {}
     // short
-    Flag(char c, std::string_view desc, std::function<void()> f)
-                 : Flag(c, std::string_view(), desc, f)
+    template <typename F> requires (std::invocable<F &> && !std::invocable<F &, std::string_view>)
+    Flag(char c, std::string_view desc, F &&f)
+                 : Flag(c, std::string_view(), desc, std::forward<F>(f))
+    {}
+
+    // std::move_only_function keeps callables of up to three pointers that
+    // are nothrow-movable in place (libstdc++); others are allocated
+    template <typename F>
+    static constexpr uint32_t allocated()
+    {
+        bool in_place = sizeof(F) <= 3 * sizeof(void *) && alignof(F) <= alignof(void *)
+                        && std::is_nothrow_move_constructible_v<F>;
+        return in_place ? 0 : sizeof(F);
+    }
+private:
+    // Built in place inside `action`, so the callable is constructed once
+    template <typename F>
+    struct IgnoreArg {
+        F f;
+
+        template <typename G>
+        explicit IgnoreArg(G &&g) : f(std::forward<G>(g)) {}
+        void operator()(std::string_view optarg) { (void)optarg; f(); }
+    };
+};
+
+// Positional argument slot, matched in order of registration against the
+// arguments left after option parsing
+struct Positional {
+    static constexpr size_t unlimited = SIZE_MAX;
+
+    std::string_view name;
+    size_t min;
+    size_t max;
+    // Receives all arguments of the slot as one contiguous array
+    std::function<void(std::span<const std::string_view> args)> action;
+
+    // Between min and max arguments: NAME... if max is unlimited, [NAME] if
+    // optional
+    Positional(std::string_view n, size_t lo, size_t hi,
+               std::function<void(std::span<const std::string_view> args)> f)
+                : name(n), min(lo), max(hi), action(f)
+    {}
+    // Exactly one argument
+    Positional(std::string_view n, std::function<void(std::string_view arg)> f)
+                : Positional(n, 1, 1, [f](auto args){ f(args[0]); })
     {}
 };
 
-class Parser {
-public:
-    void add(Flag f);
-    void add_help(std::string_view usage);
-    void parse(int argc, const char *const *argv);
-private:
-    std::vector<Flag> flags;
+// Integers first, first+step, ..., last; step > 0. Arithmetic is done
+// unsigned, so ranges may span all of long long
+struct Range {
+    long long first;
+    long long last;
+    long long step;
+
+    class iterator {
+    public:
+        using value_type = long long;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        iterator(const Range &r) : value(r.first), last(r.last), step(r.step) {}
+
+        long long operator*() const { return value; }
+        iterator &operator++()
+        {
+            if (value == last)
+                done = true;
+            else
+                value = static_cast<long long>(static_cast<unsigned long long>(value) + step);
+            return *this;
+        }
+        iterator operator++(int) { auto old = *this; ++*this; return old; }
+        bool operator==(std::default_sentinel_t) const { return done; }
+    private:
+        long long value = 0;
+        long long last = 0;
+        long long step = 1;
+        bool done = false;
+    };
+
+    bool contains(long long v) const
+    {
+        return v >= first && v <= last
+               && (static_cast<unsigned long long>(v) - static_cast<unsigned long long>(first)) % step == 0;
+    }
+    // Saturates at SIZE_MAX
+    size_t size() const
+    {
+        unsigned long long n = (static_cast<unsigned long long>(last) - static_cast<unsigned long long>(first)) / step;
+        return n >= SIZE_MAX ? SIZE_MAX : n + 1;
+    }
+    iterator begin() const { return iterator(*this); }
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+};
+
+// Sorted list of ranges; ranges with the same step and phase that overlap or
+// touch are merged. Values are never materialized
+class RangeSet {
+public:
+    // O(log n) when the ranges do not overlap
+    bool contains(long long v) const;
+    // Values shared by ranges of different steps or phases are counted once
+    // per range. Saturates at SIZE_MAX
+    size_t size() const;
+    bool empty() const { return ranges.empty(); }
+    void clear() { ranges.clear(); reach.clear(); }
+
+    std::vector<Range>::const_iterator begin() const { return ranges.begin(); }
+    std::vector<Range>::const_iterator end() const { return ranges.end(); }
+private:
+    friend class Parser;
+
+    std::vector<Range> ranges;
+    // reach[i]: greatest last of ranges[0..i]
+    std::vector<long long> reach;
+
+    void normalize();
+};
+
+// Glob patterns: * matches any string, ? any character, [abc], [a-z] and
+// [!abc] a character class
+class PatternSet {
+public:
+    // True if any pattern matches all of s
+    bool matches(std::string_view s) const;
+    bool empty() const { return patterns.empty(); }
+    void clear();
+private:
+    friend class Parser;
+
+    std::vector<std::string_view> patterns;
+
+    // Compiled: literal patterns, 'literal*' and '*literal' are looked up by
+    // hash once per distinct length, the rest are matched one by one
+    std::unordered_set<std::string_view> exact;
+    std::unordered_set<std::string_view> prefixes;
+    std::unordered_set<std::string_view> suffixes;
+    std::vector<size_t> prefix_lengths;
+    std::vector<size_t> suffix_lengths;
+    std::vector<std::string_view> globs;
+
+    void compile();
+};
+
+#ifdef JARGS_NET
+// IPv4 and IPv6 prefixes, stored as sorted, merged address intervals
+class CidrSet {
+public:
+    // O(log n); IPv4-mapped IPv6 addresses are looked up as IPv4, and the
+    // IPv4-mapped part of an IPv6 prefix is stored as IPv4
+    bool contains(const in_addr &addr) const;
+    bool contains(const in6_addr &addr) const;
+    bool empty() const { return v4.empty() && v6.empty(); }
+    void clear() { v4.clear(); v6.clear(); }
+private:
+    friend class Parser;
+
+    // High and low 64 bits of an IPv6 address
+    using Address6 = std::pair<uint64_t, uint64_t>;
+
+    // Inclusive [first, last] in host byte order
+    std::vector<std::pair<uint32_t, uint32_t>> v4;
+    std::vector<std::pair<Address6, Address6>> v6;
+
+    void normalize();
+};
+#endif
+
+// find(1)-style predicate expression, given among the arguments:
+//   -name '*.c' -o ( -size +1M -a ! -newer ref )
+// Operators are ( ) ! -not -a -and -o -or; adjacent operands are joined by
+// -a. Once parsed, it is compiled to bytecode that short-circuits like
+// find does. The untyped part of Expression<T>
+class ExpressionBase {
+public:
+    ExpressionBase() = default;
+    // Operands refer back to the expression that owns their predicates
+    ExpressionBase(const ExpressionBase &) = delete;
+    ExpressionBase &operator=(const ExpressionBase &) = delete;
+
+    bool empty() const { return code.empty(); }
+protected:
+    // `make` turns the value of one occurrence into predicate number `index`
+    void add_operand(std::string_view token, bool has_value,
+                     std::function<void(uint32_t index, std::string_view arg)> make);
+
+    // Run the bytecode; test(i) evaluates predicate i. A template so that
+    // each TEST is a single call through the predicate itself
+    template <typename Test>
+    bool evaluate(Test test) const
+    {
+        bool result = true;
+        for (size_t pc = 0; pc < code.size(); pc++) {
+            const Op op = code[pc];
+            switch (op.op) {
+            case TEST:
+                result = test(op.arg);
+                break;
+            case INVERT:
+                result = !result;
+                break;
+            case JUMP_FALSE:
+                if (!result)
+                    pc = op.arg - 1;
+                break;
+            case JUMP_TRUE:
+                if (result)
+                    pc = op.arg - 1;
+                break;
+            }
+        }
+        return result;
+    }
+private:
+    friend class Parser;
+
+    enum Kind : uint8_t { OPERAND, NOT, AND, OR, OPEN, CLOSE };
+    enum Opcode : uint8_t { TEST, INVERT, JUMP_FALSE, JUMP_TRUE };
+
+    static constexpr std::pair<std::string_view, Kind> ops[] = {
+        {"(", OPEN}, {")", CLOSE}, {"!", NOT}, {"-not", NOT},
+        {"-a", AND}, {"-and", AND}, {"-o", OR}, {"-or", OR},
+    };
+
+    struct Operand {
+        std::string_view token;
+        bool has_value;
+        std::function<void(uint32_t index, std::string_view arg)> make;
+    };
+    // Token or tree node; `a` is the predicate of an OPERAND, a and b the
+    // children of other nodes
+    struct Node {
+        Kind kind;
+        uint32_t a;
+        uint32_t b;
+    };
+    struct Op {
+        Opcode op;
+        uint32_t arg;
+    };
+
+    std::vector<Operand> operands;
+    std::vector<Node> tokens;
+    std::vector<Node> nodes;
+    std::vector<Op> code;
+    // Predicates made by the current parse
+    uint32_t predicate_count = 0;
+
+    void reset();
+    // True if the argument `arg` would be taken as an operator or operand
+    bool is_token(std::string_view arg) const;
+    // Arguments taken from argv, 0 if argv[0] is no part of an expression,
+    // -1 if its value is missing
+    int consume(int argc, const char *const *argv);
+    // Error message, empty on success
+    std::string_view compile();
+
+    std::string_view parse_or(size_t &pos, uint32_t &node);
+    std::string_view parse_and(size_t &pos, uint32_t &node);
+    std::string_view parse_unary(size_t &pos, uint32_t &node);
+    void generate(uint32_t node);
+};
+
+template <typename T>
+class Expression : public ExpressionBase {
+public:
+    using Predicate = std::function<bool(const T &x)>;
+
+    // Operand taking a value, e.g. -name PATTERN
+    void add(std::string_view token, std::function<Predicate(std::string_view arg)> make)
+    {
+        add_operand(token, true, store(std::move(make)));
+    }
+    // Operand without value, e.g. -empty
+    void add(std::string_view token, std::function<Predicate()> make)
+    {
+        add_operand(token, false, store([make = std::move(make)](std::string_view) { return make(); }));
+    }
+
+    // True for an empty expression
+    bool operator()(const T &x) const
+    {
+        return evaluate([this, &x](uint32_t i) { return predicates[i](x); });
+    }
+private:
+    std::vector<Predicate> predicates;
+
+    // Predicates of an earlier parse are dropped as the first ones of the
+    // next are made
+    auto store(std::function<Predicate(std::string_view arg)> make)
+    {
+        return [this, make = std::move(make)](uint32_t index, std::string_view arg) {
+            predicates.resize(index);
+            predicates.push_back(make(arg));
+        };
+    }
+};
+
+#ifdef JARGS_NET
+// Endpoints as a contiguous array ready for connect()/bind()
+class EndpointList {
+public:
+    // Resolves a host that is not a numeric address into out (port
+    // included); returns false if it cannot
+    using Resolver = std::function<bool(std::string_view host, uint16_t port, sockaddr_storage &out)>;
+
+    // Names are resolved once parsing finishes; without a resolver they
+    // are an error
+    void set_resolver(Resolver r) { resolver = std::move(r); }
+
+    const sockaddr_storage *data() const { return addrs.data(); }
+    size_t size() const { return addrs.size(); }
+    bool empty() const { return addrs.empty(); }
+    // Keeps the resolver
+    void clear() { addrs.clear(); unresolved.clear(); }
+    std::vector<sockaddr_storage>::const_iterator begin() const { return addrs.begin(); }
+    std::vector<sockaddr_storage>::const_iterator end() const { return addrs.end(); }
+private:
+    friend class Parser;
+
+    struct Unresolved {
+        size_t index;
+        std::string_view host;
+        uint16_t port;
+    };
+
+    std::vector<sockaddr_storage> addrs;
+    std::vector<Unresolved> unresolved;
+    Resolver resolver;
+};
+#endif
+
+// One matched flag, see Parser::record_occurrences()
+struct Occurrence {
+    // Index of the flag in order of registration, see Parser::flag()
+    uint32_t flag;
+    // Index of the argument the flag appeared in
+    uint32_t argv_index;
+    std::string_view value;
+};
+
+// Bytes held by a Parser, see Parser::memory_usage()
+struct MemoryUsage {
+    // Flag table
+    size_t flags;
+    // Actions that std::move_only_function could not store in place,
+    // including those wrapped by add_file(), add_indirect() and add_async()
+    size_t callables;
+    // Hashes of folded long names, names reserved by add_removed()
+    size_t index;
+    // Unescaped JSON strings
+    size_t strings;
+    // Files mapped or read for '@path' values
+    size_t mapped;
+    // Sections, positionals, slots, finishers
+    size_t other;
+
+    size_t total() const { return flags + callables + index + strings + mapped + other; }
+};
+
+class Parser {
+public:
+    Parser() = default;
+    Parser(const Parser &) = delete;
+    Parser &operator=(const Parser &) = delete;
+    ~Parser();
+
+    void add(Flag f);
+    // Construct the flag in place: add('f', "flag", "Set flag", action)
+    template <typename... Args> requires std::constructible_from<Flag, Args...>
+    void add(Args &&...args)
+    {
+        index(flags.emplace_back(std::forward<Args>(args)...));
+    }
+    // Match long names ignoring case, '-' and '_': --MaxConns, --max-conns
+    // and --max_conns all find "max-conns". No two long names may fold to
+    // the same string
+    void fold_long_names();
+    // Flags added after this call are listed under `name` in the help page
+    void section(std::string_view name);
+    // -h, --help: print all flags; --help=PATTERN: only flags whose name or
+    // description contains PATTERN; --help-section NAME: only flags in NAME
+    // An empty usage is generated from the program name and positionals
+    void add_help(std::string_view usage = std::string_view());
+    void add_positional(Positional p);
+    // Flag taking integer ranges, repeated or comma-separated: N, A..B or
+    // A-B (inclusive), each optionally followed by :STEP
+    void add_ranges(char c, std::string_view s, std::string_view desc, RangeSet &out);
+    void add_ranges(std::string_view s, std::string_view desc, RangeSet &out);
+    // Flag collecting one glob pattern per occurrence
+    void add_patterns(char c, std::string_view s, std::string_view desc, PatternSet &out);
+    void add_patterns(std::string_view s, std::string_view desc, PatternSet &out);
+    // Flag taking IPv4/IPv6 addresses or prefixes, repeated or comma-separated:
+    // 10.0.0.0/8,192.168.1.1,fd00::/8
+#ifdef JARGS_NET
+    void add_cidrs(char c, std::string_view s, std::string_view desc, CidrSet &out);
+    void add_cidrs(std::string_view s, std::string_view desc, CidrSet &out);
+#endif
+    // Flag taking host:port endpoints, repeated or comma-separated:
+    // 10.0.0.1:80,[::1]:9090,backend:8080
+#ifdef JARGS_NET
+    void add_endpoints(char c, std::string_view s, std::string_view desc, EndpointList &out);
+    void add_endpoints(std::string_view s, std::string_view desc, EndpointList &out);
+#endif
+    // Arguments forming `e` are taken in argv order before they are looked
+    // at as flags or positionals; e is compiled when parsing finishes. A
+    // flag spelled like an operator or operand, e.g. -a or -o, is an error
+    void add_expression(ExpressionBase &e);
+    // Flag usable as normal but left out of the help page
+    void add_hidden(Flag f);
+    // Reserve the name of a flag compiled out of this build so that using it
+    // is reported as such
+    void add_removed(std::string_view long_name);
+    // Flag whose value names a file: start reading it into the page cache
+    // before calling the action
+    void add_file(Flag f);
+    // Flag accepting '@path' as its value: the action receives the contents
+    // of path, valid for the lifetime of the parser. Regular files are
+    // mapped into memory; pipes such as @/dev/stdin or @<(cmd) are read
+    void add_indirect(Flag f);
+    // Flag whose action runs off the parsing thread; parse() returns once all
+    // such actions have finished. Occurrences of one flag run in argv order
+    // on one thread, different flags concurrently on up to
+    // max_async_threads threads
+    void add_async(Flag f);
+    static constexpr unsigned max_async_threads = 16;
+    // Check that each positional argument names an existing file, with up
+    // to `threads` stat() calls in flight. The results are in path_errors();
+    // unless exit_on_failure is false, missing paths are reported and
+    // parsing fails
+    void check_paths(unsigned threads = 16, bool exit_on_failure = true);
+    void parse(int argc, const char *const *argv);
+    // Split argv on arguments equal to `separator` and parse each segment in
+    // turn, calling run() after each. Empty segments are skipped, but argv
+    // without arguments is parsed and run once. Splitting comes first, so a
+    // flag value equal to the separator splits the command too. Values set
+    // by actions carry over from one segment to the next unless run()
+    // resets them; sets filled by add_ranges() and the like accumulate until
+    // their clear()
+    void parse_each(int argc, const char *const *argv, std::string_view separator,
+                    const std::function<void()> &run);
+    // Apply a JSON object to the registered flags: {"a": {"b": 1}} sets
+    // --a.b=1, true sets a flag without value, arrays set a flag repeatedly.
+    // Views passed to actions point into `json` where no unescaping is needed,
+    // else into parser-owned copies valid until the next parse_json() call.
+    // Objects may be nested up to max_json_depth levels
+    void parse_json(std::string_view json);
+    static constexpr unsigned max_json_depth = 64;
+
+#ifdef JARGS_SERVER
+    // Resident server: accept invocations sent by forward() on the UNIX
+    // socket at `path`, which replaces an existing socket (but no other
+    // file) and is accessible only to the owner; connections from other
+    // users are refused. Each invocation runs in a child forked from this
+    // process, taking over the client's arguments, environment, working
+    // directory and standard streams; it is parsed and exits with run()'s
+    // return value. The signal dispositions of this process are left
+    // alone. Returns only if the socket cannot be set up or accepting fails
+    void serve(std::string_view path, const std::function<int()> &run);
+#endif
+
+    // Log every flag matched by parse(), in argv order
+    void record_occurrences() { recording = true; }
+
+    const std::vector<std::string_view> &positionals() const { return positional; }
+    // errno of stat() for each positional, in order, 0 if it succeeded; see
+    // check_paths()
+    const std::vector<int> &path_errors() const { return path_check_errors; }
+    const std::vector<Occurrence> &occurrences() const { return occurrence_log; }
+    const Flag &flag(uint32_t id) const { return flags[id]; }
+    // Memory owned by the parser, including unused vector capacity. Heap
+    // state owned by the callables themselves, e.g. a captured std::string's
+    // buffer, is not visible and not counted
+    MemoryUsage memory_usage() const;
+private:
+    std::vector<Flag> flags;
+    // Hashes of the folded long names of flags[i], when fold_long_names() is on
+    std::vector<uint64_t> long_hashes;
+    bool folding = false;
+    std::vector<std::string_view> removed;
+    // (index of first flag, name)
+    std::vector<std::pair<size_t, std::string_view>> sections;
+    std::vector<std::string_view> positional;
+    std::vector<Occurrence> occurrence_log;
+    bool recording = false;
+    std::vector<Positional> slots;
+    unsigned path_check_threads = 0;
+    bool path_check_exit = true;
+    std::vector<int> path_check_errors;
+    std::vector<std::pair<void *, size_t>> mappings;
+    // Contents of '@path' files that cannot be mapped, e.g. pipes
+    std::deque<std::string> file_contents;
+    // Action and values of each add_async() flag, run by finish()
+    struct AsyncJob {
+        std::move_only_function<void(std::string_view optarg)> action;
+        std::vector<std::string_view> values;
+        // Flag::callable_allocated of the action
+        uint32_t allocated;
+    };
+    std::vector<AsyncJob> async_jobs;
+    // Run by finish(), after all flags have been seen
+    std::vector<std::function<void()>> finishers;
+    ExpressionBase *expression = nullptr;
+    // Unescaped JSON strings, stable for the actions that received them
+    std::deque<std::string> json_strings;
+    std::string_view progname = "jargs";
+
+    struct JsonReader;
+
+    void index(const Flag &f);
+    // Fail if the expression would take the arguments naming f
+    void check_shadowed(const Flag &f) const;
+    // nullptr for an empty name, or one that folds to nothing
+    Flag *find_long(std::string_view name);
+    bool is_removed(std::string_view name) const;
+    Flag *find_short(char c);
+    std::string_view map_file(std::string_view path);
+    // Report an invalid item in the value of a flag and exit
+    [[noreturn]] void option_error(char c, std::string_view s, std::string_view what,
+                                   std::string_view item) const;
+
+    void check_positional_paths();
+    void match_positionals();
+    void finish();
+
+    void print_help_page(std::string_view usage, std::string_view pattern = std::string_view(),
+                         std::string_view section = std::string_view());
+};
+
+// Command line and environment for a child process, e.g. for posix_spawn():
+//   ArgvBuilder b("worker");
+//   b.option("verbose").inherit_env().mark();
+//   for (...) {
+//       b.reset();
+//       b.option("shard", id).env("SHARD", id);
+//       posix_spawn(&pid, path, nullptr, nullptr, b.argv(), b.envp());
+//   }
+// All strings live in one arena; what precedes mark() is rendered once
+class ArgvBuilder {
+public:
+    explicit ArgvBuilder(std::string_view program);
+
+    ArgvBuilder &arg(std::string_view a);
+    // --name, or --name=value if value is not empty
+    ArgvBuilder &option(std::string_view long_name, std::string_view value = std::string_view());
+    // A flag as the parser would accept it, e.g. from Parser::occurrences():
+    // --name or -c, followed by the value as its own argument if the flag
+    // takes one, even if it is empty
+    ArgvBuilder &flag(const Flag &f, std::string_view value = std::string_view());
+    ArgvBuilder &env(std::string_view name, std::string_view value);
+    // Add this process's environment
+    ArgvBuilder &inherit_env();
+
+    // Keep everything added so far across reset(); the program name always is
+    void mark();
+    // Drop everything added since mark()
+    void reset();
+
+    // Null-terminated arrays, valid until the builder is next changed
+    char *const *argv();
+    char *const *envp();
+private:
+    // Strings, each followed by '\0'
+    std::string arena;
+    // Offsets into the arena
+    std::vector<size_t> args;
+    std::vector<size_t> envs;
+    std::vector<char *> arg_pointers;
+    std::vector<char *> env_pointers;
+    size_t base_arena = 0;
+    size_t base_args = 0;
+    size_t base_envs = 0;
+
+    size_t append(std::initializer_list<std::string_view> parts);
+};
+
+// Several programs in one binary, selected by the basename of argv[0] or,
+// failing that, by the first argument:
+//   ln -s tools ls; ./ls -l   or   ./tools ls -l
+// Each program's main builds its own parser, so only the selected one is
+// constructed
+class MultiCall {
+public:
+    using Main = std::function<int(int argc, const char *const *argv)>;
+
+    void add(std::string_view name, Main main);
+    int run(int argc, const char *const *argv);
+private:
+    std::unordered_map<std::string_view, Main> programs;
+};
+
+#ifdef JARGS_NUMA
+// Number of NUMA nodes, and the node of the calling thread as sampled on its
+// first call
+unsigned numa_nodes();
+unsigned numa_node();
+
+// The untyped part of Replicated<T>: one page-aligned replica of `size`
+// bytes per node, each constructed by init() from a thread bound to the CPUs
+// of its node so that it is first touched, and so allocated, there
+class ReplicatedBase {
+public:
+    ReplicatedBase(const ReplicatedBase &) = delete;
+    ReplicatedBase &operator=(const ReplicatedBase &) = delete;
+protected:
+    ReplicatedBase(size_t size, void (*init)(void *replica, const void *arg), const void *arg);
+    ~ReplicatedBase();
+
+    unsigned nodes;
+
+    void *replica(unsigned n) const { return static_cast<char *>(pages) + n * size; }
+private:
+    size_t size;
+    void *pages;
+};
+
+// Value read on hot paths from threads on all NUMA nodes, e.g. one set by a
+// flag action: each node reads its own replica, allocated on that node.
+// std::atomic<T> must be lock-free, which limits T to a few words
+template <typename T>
+class Replicated : public ReplicatedBase {
+    static_assert(std::atomic<T>::is_always_lock_free, "Replicated<T> needs a lock-free std::atomic<T>");
+public:
+    explicit Replicated(T v = T())
+        : ReplicatedBase(sizeof(Replica), [](void *p, const void *arg) {
+              new (p) Replica{*static_cast<const T *>(arg)};
+          }, &v)
+    {
+    }
+
+    // Publish to all replicas
+    void set(T v)
+    {
+        for (unsigned n = 0; n < nodes; n++)
+            at(n).value.store(v, std::memory_order_release);
+    }
+
+    T get() const
+    {
+        unsigned n = numa_node();
+        return at(n < nodes ? n : 0).value.load(std::memory_order_acquire);
+    }
+private:
+    struct alignas(4096) Replica {
+        std::atomic<T> value;
+    };
+    static_assert(std::is_trivially_destructible_v<Replica>);
+
+    Replica &at(unsigned n) const { return *static_cast<Replica *>(replica(n)); }
+};
+#endif
+
+// Per-thread state of Override: the active override of each Setting,
+// indexed by Setting id, and how many overrides are active
+namespace detail
+{
+inline std::atomic<size_t> setting_count = 0;
+inline thread_local std::vector<const void *> setting_overrides;
+inline thread_local size_t active_overrides = 0;
+}
+
+// Value, typically set by a flag action, that can be overridden on the
+// current thread for the lifetime of an Override, e.g. for one request
+template <typename T>
+class Setting {
+public:
+    explicit Setting(T v = T()) : value(std::move(v)), id(detail::setting_count++) {}
+    // A copy would share the id, and so the overrides, of the original
+    Setting(const Setting &) = delete;
+    Setting &operator=(const Setting &) = delete;
+
+    void set(T v) { value = std::move(v); }
+
+    const T &get() const
+    {
+        if (detail::active_overrides == 0 || id >= detail::setting_overrides.size()
+                || !detail::setting_overrides[id])
+            return value;
+        return *static_cast<const T *>(detail::setting_overrides[id]);
+    }
+private:
+    template <typename> friend class Override;
+
+    T value;
+    size_t id;
+};
+
+template <typename T>
+class Override {
+public:
+    Override(const Setting<T> &s, T v) : id(s.id), value(std::move(v))
+    {
+        if (detail::setting_overrides.size() <= id)
+            detail::setting_overrides.resize(id + 1);
+        previous = detail::setting_overrides[id];
+        detail::setting_overrides[id] = &value;
+        detail::active_overrides++;
+    }
+    ~Override()
+    {
+        detail::setting_overrides[id] = previous;
+        detail::active_overrides--;
+    }
+
+    Override(const Override &) = delete;
+    Override &operator=(const Override &) = delete;
+private:
+    size_t id;
+    T value;
+    const void *previous;
+};
+
+#ifdef JARGS_SERVER
+// Client for Parser::serve(): run this invocation on the server at `path`
+// and return its exit status, or -1 if no server is listening
+int forward(std::string_view path, int argc, const char *const *argv);
+#endif
+
+} /* namespace jargs */
+
+/*
+  Developer-only flags, long names only:
+
+    JARGS_HIDDEN(parser, "dump-state", "Dump internal state", [&]() { ... });
+    JARGS_DEBUG(parser, "fault-rate", "Inject faults", [&](auto optarg) { ... });
+
+  Both are left out of the help page. Defining JARGS_STRIP_DEBUG_FLAGS
+  removes debug flags from the build, JARGS_STRIP_HIDDEN_FLAGS removes hidden
+  and debug flags: their actions and descriptions are never compiled and
+  only the name is kept to report its use.
+
+  Parts that need Linux or network headers are compiled only on request;
+  define these before every inclusion of the header:
+
+    JARGS_SERVER: Parser::serve() and forward()
+    JARGS_NUMA: numa_nodes(), numa_node() and Replicated<T>
+    JARGS_NET: CidrSet, EndpointList, Parser::add_cidrs() and add_endpoints()
+ */
+#if defined(JARGS_STRIP_HIDDEN_FLAGS)
+#define JARGS_HIDDEN(parser, long_name, ...) (parser).add_removed(long_name)
+#else
+#define JARGS_HIDDEN(parser, long_name, ...) (parser).add_hidden({long_name, __VA_ARGS__})
+#endif
+
+#if defined(JARGS_STRIP_HIDDEN_FLAGS) || defined(JARGS_STRIP_DEBUG_FLAGS)
+#define JARGS_DEBUG(parser, long_name, ...) (parser).add_removed(long_name)
+#else
+#define JARGS_DEBUG(parser, long_name, ...) (parser).add_hidden({long_name, __VA_ARGS__})
+#endif
+
+#ifdef JARGS_IMPLEMENTATION
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef JARGS_NET
+#include <arpa/inet.h>
+#endif
+
+#ifdef JARGS_NUMA
+#include <sched.h>
+#endif
+
+#ifdef JARGS_SERVER
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+namespace jargs
+{
+
+Parser::~Parser()
+{
+    for (auto [addr, size] : mappings)
+        munmap(addr, size);
+}
+
+void Parser::add(Flag f)
+{
+    flags.push_back(std::move(f));
+    index(flags.back());
+}
+
+// Lower case; separators fold to '\0' and are skipped
+static inline char fold(char c)
+{
+    return (c == '-' || c == '_') ? '\0' : (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+// FNV-1a over the folded name, computed without building it
+static uint64_t folded_hash(std::string_view s)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (char c : s) {
+        if (char f = fold(c))
+            h = (h ^ static_cast<unsigned char>(f)) * 0x100000001b3;
+    }
+    return h;
+}
+
+// True for names such as "-" or "_" that fold to nothing
+static bool folds_empty(std::string_view s)
+{
+    return std::all_of(s.begin(), s.end(), [](char c) { return !fold(c); });
+}
+
+static bool folded_equal(std::string_view a, std::string_view b)
+{
+    size_t i = 0, j = 0;
+    for (;;) {
+        while (i < a.size() && !fold(a[i]))
+            i++;
+        while (j < b.size() && !fold(b[j]))
+            j++;
+        if (i == a.size() || j == b.size())
+            return i == a.size() && j == b.size();
+        if (fold(a[i++]) != fold(b[j++]))
+            return false;
+    }
+}
+
+void Parser::fold_long_names()
+{
+    folding = true;
+    long_hashes.clear();
+    for (const auto &f : flags) {
+        // find_long() only sees the names hashed so far
+        assert(f.long_name.empty() || !find_long(f.long_name));
+        long_hashes.push_back(folded_hash(f.long_name));
+    }
+}
+
+void Parser::index(const Flag &f)
+{
+    check_shadowed(f);
+    assert(!folding || f.long_name.empty() || !find_long(f.long_name));
+    if (folding)
+        long_hashes.push_back(folded_hash(f.long_name));
+}
+
+void Parser::add_hidden(Flag f)
+{
+    f.hidden = true;
+    add(std::move(f));
+}
+
+void Parser::add_removed(std::string_view long_name)
+{
+    removed.push_back(long_name);
+}
+
+bool Parser::is_removed(std::string_view name) const
+{
+    if (folding && !folds_empty(name)) {
+        return std::any_of(removed.begin(), removed.end(), [name](auto r) {
+            return folded_equal(r, name);
+        });
+    }
+    return std::find(removed.begin(), removed.end(), name) != removed.end();
+}
+
+Flag *Parser::find_long(std::string_view name)
+{
+    // Short-only flags have an empty long name
+    if (name.empty())
+        return nullptr;
+
+    if (folding) {
+        if (folds_empty(name))
+            return nullptr;
+        uint64_t h = folded_hash(name);
+        for (size_t j = 0; j < long_hashes.size(); j++) {
+            if (long_hashes[j] == h && !flags[j].long_name.empty() && folded_equal(flags[j].long_name, name))
+                return &flags[j];
+        }
+        return nullptr;
+    }
+
+    auto it = std::find_if(flags.begin(), flags.end(), [name](const Flag &f) { return f.long_name == name; });
+    return it == flags.end() ? nullptr : &*it;
+}
+
+Flag *Parser::find_short(char c)
+{
+    auto it = std::find_if(flags.begin(), flags.end(), [c](const Flag &f) { return f.short_name == c; });
+    return it == flags.end() ? nullptr : &*it;
+}
+
+void Parser::section(std::string_view name)
+{
+    sections.emplace_back(flags.size(), name);
+}
+
+MemoryUsage Parser::memory_usage() const
+{
+    auto bytes = [](const auto &v) {
+        return v.capacity() * sizeof(v[0]);
+    };
+
+    MemoryUsage m = {};
+    m.flags = bytes(flags);
+    for (const auto &f : flags)
+        m.callables += f.callable_allocated;
+    for (const auto &job : async_jobs) {
+        m.callables += job.allocated;
+        m.other += bytes(job.values);
+    }
+    m.index = bytes(long_hashes) + bytes(removed);
+    for (const auto &s : json_strings)
+        m.strings += sizeof(s) + (s.capacity() > 15 ? s.capacity() + 1 : 0);
+    for (auto [addr, size] : mappings)
+        m.mapped += size;
+    for (const auto &s : file_contents)
+        m.mapped += sizeof(s) + (s.capacity() > 15 ? s.capacity() + 1 : 0);
+    m.other += bytes(sections) + bytes(positional) + bytes(path_check_errors) + bytes(occurrence_log)
+               + bytes(slots) + bytes(mappings) + bytes(async_jobs) + bytes(finishers);
+    return m;
+}
+
+void Parser::add_help(std::string_view usage)
+{
+    // Keep the help flags out of the last section
+    if (!sections.empty())
+        section(std::string_view());
+
+    // Takes an optional value: --help=PATTERN
+    Flag help('h', "help", "Print help", [usage, this](auto pattern) {
+        print_help_page(usage, pattern);
+        std::exit(0);
+    });
+    help.expects_value = false;
+    add(std::move(help));
+
+    if (!sections.empty()) {
+        add({"help-section", "Print help for one section", [usage, this](auto name) {
+            print_help_page(usage, std::string_view(), name);
+            std::exit(0);
+        }});
+    }
+}
+
+void Parser::add_positional(Positional p)
+{
+    assert(p.min <= p.max);
+    slots.push_back(std::move(p));
+}
+
+void Parser::option_error(char c, std::string_view s, std::string_view what, std::string_view item) const
+{
+    std::cerr << progname << ": option '";
+    if (s.empty())
+        std::cerr << '-' << c;
+    else
+        std::cerr << "--" << s;
+    std::cerr << "': invalid " << what << " '" << item << "'\n";
+    std::exit(1);
+}
+
+// Call f on each comma-separated item of list
+template <typename F>
+static void for_each_item(std::string_view list, F f)
+{
+    for (;;) {
+        std::string_view item = list.substr(0, list.find(','));
+        f(item);
+        if (item.size() == list.size())
+            break;
+        list.remove_prefix(item.size() + 1);
+    }
+}
+
+void Parser::add_ranges(char c, std::string_view s, std::string_view desc, RangeSet &out)
+{
+    add({c, s, desc, [c, s, &out, this](auto optarg) {
+        auto parse_int = [](std::string_view &in, long long &v) {
+            auto [end, ec] = std::from_chars(in.data(), in.data() + in.size(), v);
+            in.remove_prefix(end - in.data());
+            return ec == std::errc();
+        };
+
+        for_each_item(optarg, [&](std::string_view item) {
+            std::string_view in = item;
+            Range r{0, 0, 1};
+
+            bool ok = parse_int(in, r.first);
+            r.last = r.first;
+            if (ok && (in.starts_with("..") || in.starts_with('-'))) {
+                in.remove_prefix(in.starts_with("..") ? 2 : 1);
+                ok = parse_int(in, r.last);
+            }
+            if (ok && in.starts_with(':')) {
+                in.remove_prefix(1);
+                ok = parse_int(in, r.step) && r.step > 0;
+            }
+            if (!ok || !in.empty() || r.last < r.first)
+                option_error(c, s, "range", item);
+
+            // Trim to the last value actually in the sequence
+            auto span = static_cast<unsigned long long>(r.last) - static_cast<unsigned long long>(r.first);
+            r.last = static_cast<long long>(static_cast<unsigned long long>(r.first) + span / r.step * r.step);
+            if (r.first == r.last)
+                r.step = 1;
+            out.ranges.push_back(r);
+        });
+    }});
+    finishers.push_back([&out]() { out.normalize(); });
+}
+
+void Parser::add_ranges(std::string_view s, std::string_view desc, RangeSet &out)
+{
+    add_ranges('\0', s, desc, out);
+}
+
+void RangeSet::normalize()
+{
+    auto phase = [](const Range &r) {
+        long long m = r.first % r.step;
+        return m < 0 ? m + r.step : m;
+    };
+
+    // Only ranges on the same lattice, i.e. of equal step and phase, can be
+    // merged: group them and merge neighbours within each group
+    std::sort(ranges.begin(), ranges.end(), [&phase](const Range &a, const Range &b) {
+        return std::tuple(a.step, phase(a), a.first) < std::tuple(b.step, phase(b), b.first);
+    });
+
+    std::vector<Range> merged;
+    for (const auto &r : ranges) {
+        if (!merged.empty()) {
+            Range &prev = merged.back();
+            if (prev.step == r.step && phase(prev) == phase(r) && (r.first <= prev.last
+                    || static_cast<unsigned long long>(r.first) - static_cast<unsigned long long>(prev.last)
+                       <= static_cast<unsigned long long>(r.step))) {
+                prev.last = std::max(prev.last, r.last);
+                continue;
+            }
+        }
+        merged.push_back(r);
+    }
+
+    std::sort(merged.begin(), merged.end(), [](const Range &a, const Range &b) {
+        return a.first != b.first ? a.first < b.first : a.step < b.step;
+    });
+    ranges = std::move(merged);
+
+    reach.resize(ranges.size());
+    for (size_t i = 0; i < ranges.size(); i++)
+        reach[i] = i == 0 ? ranges[i].last : std::max(reach[i-1], ranges[i].last);
+}
+
+bool RangeSet::contains(long long v) const
+{
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), v, [](long long x, const Range &r) {
+        return x < r.first;
+    });
+    for (size_t i = it - ranges.begin(); i > 0 && reach[i-1] >= v; i--) {
+        if (ranges[i-1].contains(v))
+            return true;
+    }
+    return false;
+}
+
+size_t RangeSet::size() const
+{
+    size_t n = 0;
+    for (const auto &r : ranges) {
+        if (r.size() > SIZE_MAX - n)
+            return SIZE_MAX;
+        n += r.size();
+    }
+    return n;
+}
+
+void Parser::add_patterns(char c, std::string_view s, std::string_view desc, PatternSet &out)
+{
+    add({c, s, desc, [&out](auto optarg) {
+        out.patterns.push_back(optarg);
+    }});
+    finishers.push_back([&out]() { out.compile(); });
+}
+
+void Parser::add_patterns(std::string_view s, std::string_view desc, PatternSet &out)
+{
+    add_patterns('\0', s, desc, out);
+}
+
+void PatternSet::clear()
+{
+    patterns.clear();
+    exact.clear();
+    prefixes.clear();
+    suffixes.clear();
+    prefix_lengths.clear();
+    suffix_lengths.clear();
+    globs.clear();
+}
+
+void PatternSet::compile()
+{
+    exact.clear();
+    prefixes.clear();
+    suffixes.clear();
+    globs.clear();
+
+    for (auto p : patterns) {
+        auto meta = p.find_first_of("*?[");
+        if (meta == std::string_view::npos)
+            exact.insert(p);
+        else if (meta == p.size() - 1 && p.back() == '*')
+            prefixes.insert(p.substr(0, meta));
+        else if (meta == 0 && p[0] == '*' && p.find_first_of("*?[", 1) == std::string_view::npos)
+            suffixes.insert(p.substr(1));
+        else
+            globs.push_back(p);
+    }
+
+    auto lengths = [](const auto &set, auto &out) {
+        out.clear();
+        for (auto lit : set)
+            out.push_back(lit.size());
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+    lengths(prefixes, prefix_lengths);
+    lengths(suffixes, suffix_lengths);
+}
+
+// Match one character of the pattern at p[pi]; next is set to the position
+// after it
+static bool glob_char(std::string_view p, size_t pi, char c, size_t &next)
+{
+    if (p[pi] == '[') {
+        size_t j = pi + 1;
+        bool negate = j < p.size() && (p[j] == '!' || p[j] == '^');
+        if (negate)
+            j++;
+        // ']' right after the opening bracket is literal
+        size_t close = p.find(']', j + 1);
+        if (close != std::string_view::npos) {
+            bool found = false;
+            for (; j < close; j++) {
+                if (j + 2 < close && p[j+1] == '-') {
+                    found |= c >= p[j] && c <= p[j+2];
+                    j += 2;
+                } else {
+                    found |= c == p[j];
+                }
+            }
+            next = close + 1;
+            return found != negate;
+        }
+    }
+
+    next = pi + 1;
+    return p[pi] == '?' || p[pi] == c;
+}
+
+static bool glob_match(std::string_view p, std::string_view s)
+{
+    size_t pi = 0, si = 0;
+    size_t star = std::string_view::npos, mark = 0;
+
+    while (si < s.size()) {
+        size_t next;
+        if (pi < p.size() && p[pi] == '*') {
+            star = pi++;
+            mark = si;
+        } else if (pi < p.size() && glob_char(p, pi, s[si], next)) {
+            pi = next;
+            si++;
+        } else if (star != std::string_view::npos) {
+            // Let the last star absorb one more character
+            pi = star + 1;
+            si = ++mark;
+        } else {
+            return false;
+        }
+    }
+
+    while (pi < p.size() && p[pi] == '*')
+        pi++;
+    return pi == p.size();
+}
+
+bool PatternSet::matches(std::string_view s) const
+{
+    if (exact.contains(s))
+        return true;
+    for (auto n : prefix_lengths) {
+        if (n > s.size())
+            break;
+        if (prefixes.contains(s.substr(0, n)))
+            return true;
+    }
+    for (auto n : suffix_lengths) {
+        if (n > s.size())
+            break;
+        if (suffixes.contains(s.substr(s.size() - n)))
+            return true;
+    }
+    return std::any_of(globs.begin(), globs.end(), [s](auto p) {
+        return glob_match(p, s);
+    });
+}
+
+#ifdef JARGS_NET
+// Big-endian bytes to the high and low halves of an IPv6 address
+static std::pair<uint64_t, uint64_t> address6(const in6_addr &addr)
+{
+    uint64_t hi = 0, lo = 0;
+    for (int k = 0; k < 8; k++) {
+        hi = hi << 8 | addr.s6_addr[k];
+        lo = lo << 8 | addr.s6_addr[k + 8];
+    }
+    return {hi, lo};
+}
+
+void Parser::add_cidrs(char c, std::string_view s, std::string_view desc, CidrSet &out)
+{
+    add({c, s, desc, [c, s, &out, this](auto optarg) {
+        for_each_item(optarg, [&](std::string_view item) {
+            std::string_view addr = item.substr(0, item.find('/'));
+            bool is_v6 = addr.contains(':');
+            unsigned bits = is_v6 ? 128 : 32;
+            bool ok = true;
+
+            if (addr.size() < item.size()) {
+                std::string_view len = item.substr(addr.size() + 1);
+                auto [end, ec] = std::from_chars(len.data(), len.data() + len.size(), bits);
+                ok = ec == std::errc() && end == len.data() + len.size() && bits <= (is_v6 ? 128u : 32u);
+            }
+
+            if (ok && !is_v6) {
+                uint32_t a = 0;
+                std::string_view in = addr;
+                for (int k = 0; ok && k < 4; k++) {
+                    unsigned octet;
+                    auto [end, ec] = std::from_chars(in.data(), in.data() + in.size(), octet);
+                    ok = ec == std::errc() && end != in.data() && octet <= 255;
+                    in.remove_prefix(end - in.data());
+                    if (ok && k < 3) {
+                        ok = in.starts_with('.');
+                        in.remove_prefix(ok);
+                    }
+                    a = a << 8 | octet;
+                }
+                if (ok && in.empty()) {
+                    uint32_t host = bits == 32 ? 0 : UINT32_MAX >> bits;
+                    out.v4.emplace_back(a & ~host, a | host);
+                } else {
+                    ok = false;
+                }
+            } else if (ok) {
+                // inet_pton needs a terminated string
+                char buf[INET6_ADDRSTRLEN];
+                in6_addr a6;
+                ok = addr.size() < sizeof(buf);
+                if (ok) {
+                    *std::copy(addr.begin(), addr.end(), buf) = '\0';
+                    ok = inet_pton(AF_INET6, buf, &a6) == 1;
+                }
+                if (ok) {
+                    auto [hi, lo] = address6(a6);
+                    uint64_t host_hi = bits >= 64 ? 0 : UINT64_MAX >> bits;
+                    uint64_t host_lo = bits == 128 ? 0 : bits <= 64 ? UINT64_MAX : UINT64_MAX >> (bits - 64);
+                    CidrSet::Address6 first(hi & ~host_hi, lo & ~host_lo);
+                    CidrSet::Address6 last(hi | host_hi, lo | host_lo);
+
+                    // contains() looks up IPv4-mapped addresses (::ffff:0:0/96)
+                    // as IPv4, so the part of the prefix inside them goes to v4
+                    CidrSet::Address6 mapped_first(0, 0xffff00000000), mapped_last(0, 0xffffffffffff);
+                    if (first <= mapped_last && mapped_first <= last) {
+                        out.v4.emplace_back(std::max(first, mapped_first).second & UINT32_MAX,
+                                            std::min(last, mapped_last).second & UINT32_MAX);
+                    }
+                    if (first < mapped_first || mapped_last < last)
+                        out.v6.emplace_back(first, last);
+                }
+            }
+
+            if (!ok)
+                option_error(c, s, "address", item);
+        });
+    }});
+    finishers.push_back([&out]() { out.normalize(); });
+}
+
+void Parser::add_cidrs(std::string_view s, std::string_view desc, CidrSet &out)
+{
+    add_cidrs('\0', s, desc, out);
+}
+
+// True if b is a + 1
+static bool adjacent(uint32_t a, uint32_t b)
+{
+    return a != UINT32_MAX && a + 1 == b;
+}
+
+static bool adjacent(std::pair<uint64_t, uint64_t> a, std::pair<uint64_t, uint64_t> b)
+{
+    if (a.second != UINT64_MAX)
+        return b.first == a.first && b.second == a.second + 1;
+    return a.first != UINT64_MAX && b.first == a.first + 1 && b.second == 0;
+}
+
+template <typename T>
+static void merge_intervals(std::vector<std::pair<T, T>> &v)
+{
+    std::sort(v.begin(), v.end());
+
+    size_t n = 0;
+    for (size_t i = 0; i < v.size(); i++) {
+        // Overlapping or adjacent
+        if (n > 0 && (v[i].first <= v[n-1].second || adjacent(v[n-1].second, v[i].first)))
+            v[n-1].second = std::max(v[n-1].second, v[i].second);
+        else
+            v[n++] = v[i];
+    }
+    v.resize(n);
+}
+
+template <typename T>
+static bool find_interval(const std::vector<std::pair<T, T>> &v, T a)
+{
+    auto it = std::upper_bound(v.begin(), v.end(), a, [](T x, const auto &iv) {
+        return x < iv.first;
+    });
+    return it != v.begin() && a <= std::prev(it)->second;
+}
+
+void CidrSet::normalize()
+{
+    merge_intervals(v4);
+    merge_intervals(v6);
+}
+
+bool CidrSet::contains(const in_addr &addr) const
+{
+    return find_interval(v4, ntohl(addr.s_addr));
+}
+
+bool CidrSet::contains(const in6_addr &addr) const
+{
+    if (IN6_IS_ADDR_V4MAPPED(&addr)) {
+        in_addr a4;
+        std::memcpy(&a4.s_addr, addr.s6_addr + 12, 4);
+        return contains(a4);
+    }
+
+    return find_interval(v6, address6(addr));
+}
+#endif /* JARGS_NET */
+
+#ifdef JARGS_NET
+void Parser::add_endpoints(char c, std::string_view s, std::string_view desc, EndpointList &out)
+{
+    add({c, s, desc, [c, s, &out, this](auto optarg) {
+        // Grow geometrically, or repeated occurrences would reallocate each time
+        size_t needed = out.addrs.size() + std::count(optarg.begin(), optarg.end(), ',') + 1;
+        if (needed > out.addrs.capacity())
+            out.addrs.reserve(std::max(needed, 2 * out.addrs.capacity()));
+
+        for_each_item(optarg, [&](std::string_view item) {
+            std::string_view host;
+            std::string_view port_str;
+            bool ok = true;
+
+            // [v6]:port or host:port
+            if (item.starts_with('[')) {
+                size_t close = item.find("]:");
+                ok = close != std::string_view::npos;
+                host = item.substr(1, close - 1);
+                port_str = item.substr(close + 2);
+            } else {
+                size_t colon = item.rfind(':');
+                ok = colon != std::string_view::npos;
+                host = item.substr(0, colon);
+                port_str = item.substr(colon + 1);
+            }
+
+            uint16_t port = 0;
+            if (ok) {
+                auto [end, ec] = std::from_chars(port_str.data(), port_str.data() + port_str.size(), port);
+                ok = ec == std::errc() && end == port_str.data() + port_str.size() && !host.empty();
+            }
+
+            sockaddr_storage &ss = out.addrs.emplace_back();
+            char buf[INET6_ADDRSTRLEN];
+            if (ok && host.size() < sizeof(buf)) {
+                *std::copy(host.begin(), host.end(), buf) = '\0';
+                auto sin = reinterpret_cast<sockaddr_in *>(&ss);
+                auto sin6 = reinterpret_cast<sockaddr_in6 *>(&ss);
+                if (inet_pton(AF_INET, buf, &sin->sin_addr) == 1) {
+                    sin->sin_family = AF_INET;
+                    sin->sin_port = htons(port);
+                } else if (inet_pton(AF_INET6, buf, &sin6->sin6_addr) == 1) {
+                    sin6->sin6_family = AF_INET6;
+                    sin6->sin6_port = htons(port);
+                } else {
+                    out.unresolved.push_back({out.addrs.size() - 1, host, port});
+                }
+            } else if (ok) {
+                out.unresolved.push_back({out.addrs.size() - 1, host, port});
+            }
+
+            if (!ok)
+                option_error(c, s, "endpoint", item);
+        });
+    }});
+
+    finishers.push_back([&out, this]() {
+        for (const auto &u : out.unresolved) {
+            if (!out.resolver || !out.resolver(u.host, u.port, out.addrs[u.index])) {
+                std::cerr << progname << ": cannot resolve '" << u.host << "'\n";
+                std::exit(1);
+            }
+        }
+        out.unresolved.clear();
+    });
+}
+
+void Parser::add_endpoints(std::string_view s, std::string_view desc, EndpointList &out)
+{
+    add_endpoints('\0', s, desc, out);
+}
+#endif /* JARGS_NET */
+
+void Parser::check_shadowed(const Flag &f) const
+{
+    if (!expression)
+        return;
+
+    std::string names[] = {
+        f.short_name ? std::string{'-', f.short_name} : std::string(),
+        f.long_name.empty() ? std::string() : "--" + std::string(f.long_name),
+    };
+    for (const auto &name : names) {
+        if (!name.empty() && expression->is_token(name)) {
+            std::cerr << progname << ": option '" << name << "' is spelled like an expression operator or operand\n";
+            std::exit(1);
+        }
+    }
+}
+
+void Parser::add_expression(ExpressionBase &e)
+{
+    expression = &e;
+    for (const auto &f : flags)
+        check_shadowed(f);
+    finishers.push_back([&e, this]() {
+        auto error = e.compile();
+        if (!error.empty()) {
+            std::cerr << progname << ": invalid expression: " << error << '\n';
+            std::exit(1);
+        }
+    });
+}
+
+void ExpressionBase::add_operand(std::string_view token, bool has_value,
+                                 std::function<void(uint32_t index, std::string_view arg)> make)
+{
+    operands.push_back({token, has_value, std::move(make)});
+}
+
+void ExpressionBase::reset()
+{
+    tokens.clear();
+    nodes.clear();
+    code.clear();
+    predicate_count = 0;
+}
+
+bool ExpressionBase::is_token(std::string_view arg) const
+{
+    return std::any_of(std::begin(ops), std::end(ops), [arg](const auto &op) {
+               return op.first == arg;
+           })
+           || std::any_of(operands.begin(), operands.end(), [arg](const auto &o) { return o.token == arg; });
+}
+
+int ExpressionBase::consume(int argc, const char *const *argv)
+{
+    std::string_view arg = argv[0];
+
+    for (auto [name, kind] : ops) {
+        if (arg == name) {
+            tokens.push_back({kind, 0, 0});
+            return 1;
+        }
+    }
+
+    auto op = std::find_if(operands.begin(), operands.end(), [arg](const auto &o) {
+        return o.token == arg;
+    });
+    if (op == operands.end())
+        return 0;
+    if (op->has_value && argc < 2)
+        return -1;
+
+    tokens.push_back({OPERAND, predicate_count, 0});
+    op->make(predicate_count++, op->has_value ? argv[1] : std::string_view());
+    return op->has_value ? 2 : 1;
+}
+
+std::string_view ExpressionBase::compile()
+{
+    nodes.clear();
+    code.clear();
+    if (tokens.empty())
+        return std::string_view();
+
+    size_t pos = 0;
+    uint32_t root;
+    auto error = parse_or(pos, root);
+    if (error.empty() && pos < tokens.size())
+        error = tokens[pos].kind == CLOSE ? "unexpected ')'" : "unexpected operator";
+    if (error.empty())
+        generate(root);
+    return error;
+}
+
+// or := and (-o and)*
+std::string_view ExpressionBase::parse_or(size_t &pos, uint32_t &node)
+{
+    auto error = parse_and(pos, node);
+    while (error.empty() && pos < tokens.size() && tokens[pos].kind == OR) {
+        uint32_t rhs;
+        pos++;
+        error = parse_and(pos, rhs);
+        nodes.push_back({OR, node, rhs});
+        node = nodes.size() - 1;
+    }
+    return error;
+}
+
+// and := unary ([-a] unary)*
+std::string_view ExpressionBase::parse_and(size_t &pos, uint32_t &node)
+{
+    auto error = parse_unary(pos, node);
+    while (error.empty() && pos < tokens.size()) {
+        Kind k = tokens[pos].kind;
+        if (k == AND)
+            pos++;
+        else if (k != OPERAND && k != NOT && k != OPEN)
+            break;
+
+        uint32_t rhs;
+        error = parse_unary(pos, rhs);
+        nodes.push_back({AND, node, rhs});
+        node = nodes.size() - 1;
+    }
+    return error;
+}
+
+// unary := ! unary | ( or ) | operand
+std::string_view ExpressionBase::parse_unary(size_t &pos, uint32_t &node)
+{
+    if (pos >= tokens.size())
+        return "expected operand";
+
+    const Node &t = tokens[pos++];
+    switch (t.kind) {
+    case OPERAND:
+        nodes.push_back(t);
+        node = nodes.size() - 1;
+        return std::string_view();
+    case NOT: {
+        uint32_t child;
+        auto error = parse_unary(pos, child);
+        nodes.push_back({NOT, child, 0});
+        node = nodes.size() - 1;
+        return error;
+    }
+    case OPEN: {
+        auto error = parse_or(pos, node);
+        if (error.empty() && (pos >= tokens.size() || tokens[pos++].kind != CLOSE))
+            error = "missing ')'";
+        return error;
+    }
+    case CLOSE:
+        return "unexpected ')'";
+    default:
+        return "expected operand";
+    }
+}
+
+void ExpressionBase::generate(uint32_t node)
+{
+    const Node n = nodes[node];
+    switch (n.kind) {
+    case OPERAND:
+        code.push_back({TEST, n.a});
+        break;
+    case NOT:
+        generate(n.a);
+        code.push_back({INVERT, 0});
+        break;
+    case AND:
+    case OR: {
+        // Skip the right side once the left decides the result
+        generate(n.a);
+        size_t jump = code.size();
+        code.push_back({n.kind == AND ? JUMP_FALSE : JUMP_TRUE, 0});
+        generate(n.b);
+        code[jump].arg = code.size();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Parser::add_file(Flag f)
+{
+    assert(f.expects_value);
+
+    Flag file(f.short_name, f.long_name, f.description, [action = std::move(f.action)](auto optarg) mutable {
+        // Errors are left for the action to report when it opens the file
+        std::string path(optarg);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            close(fd);
+        }
+        action(optarg);
+    });
+    // The wrapper owns the original action
+    file.callable_allocated += f.callable_allocated;
+    add(std::move(file));
+}
 
-    void print_help_page(std::string_view usage);
-};
+void Parser::add_indirect(Flag f)
+{
+    assert(f.expects_value);
 
-} /* namespace jargs */
+    Flag indirect(f.short_name, f.long_name, f.description, [action = std::move(f.action), this](auto optarg) mutable {
+        if (optarg.starts_with('@'))
+            action(map_file(optarg.substr(1)));
+        else
+            action(optarg);
+    });
+    indirect.callable_allocated += f.callable_allocated;
+    add(std::move(indirect));
+}
 
-#ifdef JARGS_IMPLEMENTATION
+void Parser::add_async(Flag f)
+{
+    size_t job = async_jobs.size();
+    async_jobs.push_back({std::move(f.action), {}, f.callable_allocated});
 
-#include <algorithm>
-#include <cassert>
-#include <iostream>
-#include <sstream>
+    Flag async(f.short_name, f.long_name, f.description, [job, this](auto optarg) {
+        async_jobs[job].values.push_back(optarg);
+    });
+    async.expects_value = f.expects_value;
+    add(std::move(async));
+}
 
-namespace jargs
+std::string_view Parser::map_file(std::string_view path)
 {
+    std::string p(path);
+    int fd = open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        std::cerr << progname << ": cannot read '" << path << "': " << std::strerror(errno) << '\n';
+        std::exit(1);
+    }
 
-void Parser::add(Flag f)
+    // Pipes and FIFOs cannot be mapped, and procfs files report no size
+    // (nor can mmap() map nothing): read these until end of file
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        std::string &contents = file_contents.emplace_back();
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) != 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                std::cerr << progname << ": cannot read '" << path << "': " << std::strerror(errno) << '\n';
+                std::exit(1);
+            }
+            contents.append(buf, n);
+        }
+        close(fd);
+        return contents;
+    }
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << progname << ": cannot read '" << path << "': " << std::strerror(err) << '\n';
+        std::exit(1);
+    }
+
+    mappings.emplace_back(addr, st.st_size);
+    return std::string_view(static_cast<const char *>(addr), st.st_size);
+}
+
+void Parser::check_paths(unsigned threads, bool exit_on_failure)
 {
-    flags.push_back(std::move(f));
+    path_check_threads = std::max(threads, 1u);
+    path_check_exit = exit_on_failure;
 }
 
-void Parser::add_help(std::string_view usage)
+void Parser::check_positional_paths()
 {
-    add({'h', "help", "Print help", [usage, this](){
-        print_help_page(usage);
-        std::exit(0);
-    }});
+    // stat() blocks for a full round trip on network filesystems, so keep
+    // several requests in flight even for a few paths; results stay in
+    // argument order
+    std::vector<int> &errors = path_check_errors;
+    errors.assign(positional.size(), 0);
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        struct stat st;
+        for (size_t j; (j = next++) < positional.size();)
+            errors[j] = stat(positional[j].data(), &st) == 0 ? 0 : errno;
+    };
+
+    std::vector<std::thread> pool;
+    size_t n = std::min<size_t>(path_check_threads, positional.size());
+    for (size_t t = 1; t < n; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool)
+        t.join();
+
+    if (!path_check_exit)
+        return;
+
+    bool failed = false;
+    for (size_t j = 0; j < positional.size(); j++) {
+        if (errors[j] != 0) {
+            std::cerr << progname << ": cannot access '" << positional[j] << "': " << std::strerror(errors[j]) << '\n';
+            failed = true;
+        }
+    }
+    if (failed)
+        std::exit(1);
 }
 
 void Parser::parse(int argc, const char *const *argv)
 {
+    progname = argv[0];
+    positional.clear();
+    if (expression) {
+        // Operands may have been added since add_expression()
+        for (const auto &f : flags)
+            check_shadowed(f);
+        expression->reset();
+    }
+    if (recording) {
+        // Reserve for the most flags argv can hold, so that recording never
+        // reallocates: a bundle such as -abc holds one per letter
+        size_t most = 0;
+        for (int i = 1; i < argc; i++) {
+            std::string_view arg = argv[i];
+            most += arg.size() > 2 && arg[0] == '-' && arg[1] != '-' ? arg.size() - 1 : 1;
+        }
+        occurrence_log.clear();
+        occurrence_log.reserve(most);
+    }
+
     for (int i = 1; i < argc; i++) {
         std::string_view arg = argv[i];
 
+        auto call = [this, at = i](Flag *spec, std::string_view optarg) {
+            if (recording)
+                occurrence_log.push_back({uint32_t(spec - flags.data()), uint32_t(at), optarg});
+            spec->action(optarg);
+        };
+
+        if (expression) {
+            int used = expression->consume(argc - i, argv + i);
+            if (used < 0) {
+                std::cerr << argv[0] << ": option '" << arg << "' requires an argument\n";
+                std::exit(1);
+            }
+            if (used > 0) {
+                i += used - 1;
+                continue;
+            }
+        }
+
         if (arg.size() >= 3 && arg.starts_with("--")) {
             auto flag = arg.substr(2, arg.find('=')-2);
 
-            auto spec = std::find_if(flags.begin(), flags.end(), [flag](const auto &f){
-                    return f.long_name == flag;
-                    });
+            auto spec = find_long(flag);
 
-            if (spec == flags.end()) {
+            if (!spec && is_removed(flag)) {
+                std::cerr << argv[0] << ": option '--" << flag << "' is not available in this build\n";
+                std::exit(1);
+            }
+            if (!spec) {
                 std::cerr << argv[0] << ": unknown option: '--" << flag << "'\n";
                 std::exit(1);
             }
@@ -186,7 +1965,7 @@ void Parser::parse(int argc, const char *const *argv)
                         std::cerr << argv[0] << ": option '--" << flag << "' requires an argument\n";
                         std::exit(1);
                     } else {
-                        spec->action(optarg);
+                        call(spec, optarg);
                     }
                 // --opt arg
                 } else {
@@ -194,12 +1973,12 @@ void Parser::parse(int argc, const char *const *argv)
                         std::cerr << argv[0] << ": option '--" << flag << "' requires an argument\n";
                         std::exit(1);
                     } else {
-                        spec->action(argv[++i]);
+                        call(spec, argv[++i]);
                     }
                 }
-            // --opt
+            // --opt, --opt=arg is passed on for flags with optional values
             } else {
-                spec->action(std::string_view());
+                call(spec, arg.contains('=') ? arg.substr(arg.find('=')+1) : std::string_view());
             }
         } else if (arg.size() >= 2 && arg.starts_with('-')) {
             auto flag = arg.substr(1);
@@ -207,11 +1986,9 @@ void Parser::parse(int argc, const char *const *argv)
             for (size_t j = 0; j < flag.size(); j++) {
                 char c = flag[j];
 
-                auto spec = std::find_if(flags.begin(), flags.end(), [c](const auto &f){
-                        return f.short_name == c;
-                        });
+                auto spec = find_short(c);
 
-                if (spec == flags.end()) {
+                if (!spec) {
                     std::cerr << argv[0] << ": unknown option: '-" << c << "'\n";
                     std::exit(1);
                 }
@@ -219,7 +1996,7 @@ void Parser::parse(int argc, const char *const *argv)
                 if (spec->expects_value) {
                     // -oarg
                     if (j != flag.size()-1) {
-                        spec->action(flag.substr(j+1));
+                        call(spec, flag.substr(j+1));
                         break;
                     // -o arg
                     } else {
@@ -227,40 +2004,867 @@ void Parser::parse(int argc, const char *const *argv)
                             std::cerr << argv[0] << ": option '-" << c << "' requires an argument\n";
                             std::exit(1);
                         } else {
-                            spec->action(argv[++i]);
+                            call(spec, argv[++i]);
                         }
                     }
                 // -o
                 } else {
-                    spec->action(std::string_view());
+                    call(spec, std::string_view());
+                }
+            }
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    finish();
+
+    if (path_check_threads)
+        check_positional_paths();
+    if (!slots.empty())
+        match_positionals();
+}
+
+void Parser::parse_each(int argc, const char *const *argv, std::string_view separator,
+                        const std::function<void()> &run)
+{
+    std::vector<const char *> segment;
+    segment.reserve(argc);
+
+    int start = 1;
+    for (int i = 1; i <= argc; i++) {
+        if (i < argc && argv[i] != separator)
+            continue;
+        if (i == start && argc > 1) {
+            start = i + 1;
+            continue;
+        }
+
+        segment.assign(1, argv[0]);
+        segment.insert(segment.end(), argv + start, argv + i);
+        parse(segment.size(), segment.data());
+        run();
+        start = i + 1;
+    }
+}
+
+#ifdef JARGS_SERVER
+// Header of a forwarded invocation, followed by `size` bytes of
+// NUL-terminated strings: the working directory, argc arguments and envc
+// environment entries. Standard streams are passed as SCM_RIGHTS
+struct ForwardHeader {
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t size;
+};
+
+static bool read_all(int fd, void *buf, size_t n)
+{
+    for (auto p = static_cast<char *>(buf); n > 0;) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t n)
+{
+    for (auto p = static_cast<const char *>(buf); n > 0;) {
+        ssize_t r = write(fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool unix_address(std::string_view path, sockaddr_un &addr)
+{
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    return true;
+}
+
+void Parser::serve(std::string_view path, const std::function<int()> &run)
+{
+    sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || !unix_address(path, addr)) {
+        std::cerr << progname << ": cannot serve on '" << path << "'\n";
+        return;
+    }
+
+    // Replace a stale socket, but never some other file at that path
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << progname << ": cannot serve on '" << path << "': not a socket\n";
+            close(sock);
+            return;
+        }
+        unlink(addr.sun_path);
+    }
+
+    // The socket is created accessible only to the owner, with no window
+    // in which others could connect
+    mode_t mask = umask(0077);
+    int bound = bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    umask(mask);
+    if (bound < 0 || listen(sock, SOMAXCONN) < 0) {
+        std::cerr << progname << ": cannot serve on '" << path << "': " << std::strerror(errno) << '\n';
+        close(sock);
+        return;
+    }
+
+    // Or buffered output would be repeated by every child
+    std::cout.flush();
+
+    for (;;) {
+        int conn = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Out of descriptors or memory: wait for handlers to exit
+            // instead of spinning
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                usleep(100000);
+                continue;
+            }
+            std::cerr << progname << ": cannot accept on '" << path << "': " << std::strerror(errno) << '\n';
+            close(sock);
+            return;
+        }
+
+        ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || cred.uid != geteuid()) {
+            close(conn);
+            continue;
+        }
+
+        // The handler is forked twice so that it is reaped by init: the
+        // accepting process only waits for the short-lived middle child
+        pid_t middle = fork();
+        if (middle != 0) {
+            close(conn);
+            if (middle > 0)
+                waitpid(middle, nullptr, 0);
+            continue;
+        }
+        if (fork() != 0)
+            _exit(0);
+
+        // Connection handler: receive the invocation, run it in another
+        // child and report how it exited
+        close(sock);
+
+        ForwardHeader hdr;
+        int fds[3];
+        iovec iov = {&hdr, sizeof(hdr)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr *cmsg;
+        if (recvmsg(conn, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(hdr)
+                || !(cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_type != SCM_RIGHTS
+                || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+            _exit(1);
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+        std::vector<char> blob(hdr.size);
+        if (!read_all(conn, blob.data(), blob.size()) || blob.empty() || blob.back() != '\0')
+            _exit(1);
+
+        std::vector<char *> strings;
+        for (size_t off = 0; off < blob.size(); off += std::strlen(&blob[off]) + 1)
+            strings.push_back(&blob[off]);
+        if (strings.size() != 1 + size_t(hdr.argc) + hdr.envc || hdr.argc == 0)
+            _exit(1);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            for (int fd = 0; fd < 3; fd++)
+                dup2(fds[fd], fd);
+            if (chdir(strings[0]) < 0)
+                _exit(1);
+            clearenv();
+            for (size_t j = 1 + hdr.argc; j < strings.size(); j++)
+                putenv(strings[j]);
+
+            parse(hdr.argc, strings.data() + 1);
+            std::exit(run());
+        }
+
+        int status = 1;
+        if (pid > 0 && waitpid(pid, &status, 0) == pid)
+            status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        int32_t code = status;
+        write_all(conn, &code, sizeof(code));
+        _exit(0);
+    }
+}
+
+int forward(std::string_view path, int argc, const char *const *argv)
+{
+    sockaddr_un addr;
+    if (!unix_address(path, addr))
+        return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    std::string blob;
+    char *cwd = getcwd(nullptr, 0);
+    blob.append(cwd ? cwd : "/").push_back('\0');
+    free(cwd);
+    for (int i = 0; i < argc; i++)
+        blob.append(argv[i]).push_back('\0');
+    uint32_t envc = 0;
+    for (char **e = environ; *e; e++, envc++)
+        blob.append(*e).push_back('\0');
+
+    ForwardHeader hdr = {uint32_t(argc), envc, uint32_t(blob.size())};
+    int fds[3] = {0, 1, 2};
+    iovec iov = {&hdr, sizeof(hdr)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int32_t code;
+    bool ok = sendmsg(sock, &msg, 0) == sizeof(hdr) && write_all(sock, blob.data(), blob.size())
+              && read_all(sock, &code, sizeof(code));
+    close(sock);
+    if (!ok) {
+        std::cerr << argv[0] << ": lost connection to '" << path << "'\n";
+        return 1;
+    }
+    return code;
+}
+#endif /* JARGS_SERVER */
+
+#ifdef JARGS_NUMA
+unsigned numa_nodes()
+{
+    // "0" or "0-3"
+    static const unsigned nodes = []() {
+        std::ifstream possible("/sys/devices/system/node/possible");
+        std::string list;
+        unsigned last = 0;
+        if (possible >> list) {
+            std::string_view s = list;
+            s = s.substr(s.find_last_of("-,") + 1);
+            std::from_chars(s.data(), s.data() + s.size(), last);
+        }
+        return last + 1;
+    }();
+    return nodes;
+}
+
+// CPUs of a node as listed in sysfs, e.g. "0-3,8-11"
+static bool node_cpus(unsigned node, cpu_set_t &set)
+{
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!(file >> list))
+        return false;
+
+    CPU_ZERO(&set);
+    bool ok = true;
+    for_each_item(list, [&](std::string_view item) {
+        unsigned first = 0, last = 0;
+        std::string_view hi = item.substr(item.find('-') + 1);
+        auto [end, ec] = std::from_chars(item.data(), item.data() + item.size(), first);
+        auto [hi_end, hi_ec] = std::from_chars(hi.data(), hi.data() + hi.size(), last);
+        ok = ok && ec == std::errc() && hi_ec == std::errc() && first <= last;
+        for (unsigned cpu = first; ok && cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &set);
+    });
+    return ok && CPU_COUNT(&set) > 0;
+}
+
+ReplicatedBase::ReplicatedBase(size_t size, void (*init)(void *replica, const void *arg), const void *arg)
+    : nodes(numa_nodes()), size(size)
+{
+    // Fresh anonymous pages: none is backed by memory before init() writes it
+    pages = mmap(nullptr, nodes * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED) {
+        std::cerr << "jargs: cannot allocate replicas: " << std::strerror(errno) << '\n';
+        std::abort();
+    }
+
+    if (nodes == 1) {
+        init(replica(0), arg);
+        return;
+    }
+    for (unsigned n = 0; n < nodes; n++) {
+        // A node without CPUs, or one this process may not run on, gets
+        // its replica wherever the kernel places the calling thread's pages
+        cpu_set_t set;
+        if (!node_cpus(n, set)) {
+            init(replica(n), arg);
+            continue;
+        }
+        std::thread([&]() {
+            sched_setaffinity(0, sizeof(set), &set);
+            init(replica(n), arg);
+        }).join();
+    }
+}
+
+ReplicatedBase::~ReplicatedBase()
+{
+    munmap(pages, nodes * size);
+}
+
+unsigned numa_node()
+{
+    thread_local const unsigned node = []() {
+        unsigned cpu, node;
+        return getcpu(&cpu, &node) == 0 ? node : 0;
+    }();
+    return node;
+}
+#endif /* JARGS_NUMA */
+
+ArgvBuilder::ArgvBuilder(std::string_view program)
+{
+    // reset() never drops the program name
+    arg(program);
+    mark();
+}
+
+size_t ArgvBuilder::append(std::initializer_list<std::string_view> parts)
+{
+    size_t off = arena.size();
+    for (auto p : parts)
+        arena.append(p);
+    arena.push_back('\0');
+    return off;
+}
+
+ArgvBuilder &ArgvBuilder::arg(std::string_view a)
+{
+    args.push_back(append({a}));
+    return *this;
+}
+
+ArgvBuilder &ArgvBuilder::option(std::string_view long_name, std::string_view value)
+{
+    if (value.empty())
+        args.push_back(append({"--", long_name}));
+    else
+        args.push_back(append({"--", long_name, "=", value}));
+    return *this;
+}
+
+ArgvBuilder &ArgvBuilder::flag(const Flag &f, std::string_view value)
+{
+    if (f.long_name.empty())
+        args.push_back(append({"-", std::string_view(&f.short_name, 1)}));
+    else
+        args.push_back(append({"--", f.long_name}));
+    // As a separate argument: parse() rejects --name= with an empty value
+    if (f.expects_value)
+        arg(value);
+    return *this;
+}
+
+ArgvBuilder &ArgvBuilder::env(std::string_view name, std::string_view value)
+{
+    envs.push_back(append({name, "=", value}));
+    return *this;
+}
+
+ArgvBuilder &ArgvBuilder::inherit_env()
+{
+    for (char **e = environ; *e; e++)
+        envs.push_back(append({*e}));
+    return *this;
+}
+
+void ArgvBuilder::mark()
+{
+    base_arena = arena.size();
+    base_args = args.size();
+    base_envs = envs.size();
+}
+
+void ArgvBuilder::reset()
+{
+    arena.resize(base_arena);
+    args.resize(base_args);
+    envs.resize(base_envs);
+}
+
+char *const *ArgvBuilder::argv()
+{
+    arg_pointers.clear();
+    for (auto off : args)
+        arg_pointers.push_back(arena.data() + off);
+    arg_pointers.push_back(nullptr);
+    return arg_pointers.data();
+}
+
+char *const *ArgvBuilder::envp()
+{
+    env_pointers.clear();
+    for (auto off : envs)
+        env_pointers.push_back(arena.data() + off);
+    env_pointers.push_back(nullptr);
+    return env_pointers.data();
+}
+
+void MultiCall::add(std::string_view name, Main main)
+{
+    programs.emplace(name, std::move(main));
+}
+
+int MultiCall::run(int argc, const char *const *argv)
+{
+    auto basename = [](std::string_view path) {
+        return path.substr(path.rfind('/') + 1);
+    };
+
+    if (auto it = programs.find(basename(argv[0])); it != programs.end())
+        return it->second(argc, argv);
+    if (argc > 1) {
+        if (auto it = programs.find(basename(argv[1])); it != programs.end())
+            return it->second(argc - 1, argv + 1);
+        std::cerr << argv[0] << ": unknown program: '" << argv[1] << "'\n";
+    }
+
+    std::vector<std::string_view> names;
+    for (const auto &p : programs)
+        names.push_back(p.first);
+    std::sort(names.begin(), names.end());
+
+    std::cerr << "Usage: " << basename(argv[0]) << " PROGRAM [ARGS]\nPrograms:";
+    for (auto n : names)
+        std::cerr << ' ' << n;
+    std::cerr << '\n';
+    return 1;
+}
+
+void Parser::match_positionals()
+{
+    size_t remaining_min = 0;
+    for (const auto &p : slots)
+        remaining_min += p.min;
+
+    // Each slot gets its minimum, then as many as it accepts while leaving
+    // enough for the minimums of the slots after it
+    std::vector<size_t> takes;
+    takes.reserve(slots.size());
+    size_t next = 0;
+    for (const auto &p : slots) {
+        remaining_min -= p.min;
+        size_t avail = positional.size() - next;
+        if (avail < p.min) {
+            std::cerr << progname << ": missing argument '" << p.name << "'\n";
+            std::exit(1);
+        }
+
+        size_t take = avail > remaining_min ? std::min(p.max, avail - remaining_min) : 0;
+        takes.push_back(std::max(take, p.min));
+        next += takes.back();
+    }
+
+    if (next < positional.size()) {
+        std::cerr << progname << ": unexpected argument '" << positional[next] << "'\n";
+        std::exit(1);
+    }
+
+    next = 0;
+    for (size_t j = 0; j < slots.size(); next += takes[j++]) {
+        if (takes[j] > 0)
+            slots[j].action(std::span(positional).subspan(next, takes[j]));
+    }
+}
+
+void Parser::finish()
+{
+    // One job at a time per thread, so no callable is entered concurrently
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t j; (j = next++) < async_jobs.size();) {
+            for (auto v : async_jobs[j].values)
+                async_jobs[j].action(v);
+            async_jobs[j].values.clear();
+        }
+    };
+
+    size_t busy = std::count_if(async_jobs.begin(), async_jobs.end(), [](const auto &j) {
+        return !j.values.empty();
+    });
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < std::min<size_t>(busy, max_async_threads); t++)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+
+    for (auto &f : finishers)
+        f();
+}
+
+struct Parser::JsonReader {
+    Parser &parser;
+    std::string_view buf;
+    size_t pos = 0;
+    // Dotted name of the current member
+    std::string name;
+    unsigned depth = 0;
+
+    [[noreturn]] void fail(std::string_view what)
+    {
+        std::cerr << parser.progname << ": json: " << what << " at offset " << pos << '\n';
+        std::exit(1);
+    }
+
+    void skip_ws()
+    {
+        while (pos < buf.size() && (buf[pos] == ' ' || buf[pos] == '\t' || buf[pos] == '\n' || buf[pos] == '\r'))
+            pos++;
+    }
+
+    bool peek(char c)
+    {
+        skip_ws();
+        return pos < buf.size() && buf[pos] == c;
+    }
+
+    bool eat(char c)
+    {
+        if (!peek(c))
+            return false;
+        pos++;
+        return true;
+    }
+
+    void expect(char c)
+    {
+        if (!eat(c))
+            fail(std::string("expected '") + c + "'");
+    }
+
+    unsigned hex4()
+    {
+        if (buf.size() - pos < 4)
+            fail("truncated escape");
+        unsigned v = 0;
+        for (int k = 0; k < 4; k++) {
+            char c = buf[pos++];
+            v <<= 4;
+            if (c >= '0' && c <= '9')
+                v |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                v |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                v |= c - 'A' + 10;
+            else
+                fail("invalid escape");
+        }
+        return v;
+    }
+
+    // Expects pos on the opening quote
+    std::string_view string()
+    {
+        pos++;
+        const char *start = buf.data() + pos;
+        const char *end = buf.data() + buf.size();
+
+        // memchr is vectorized: find the closing quote, and if no backslash
+        // precedes it the string is returned in place
+        auto quote = static_cast<const char *>(std::memchr(start, '"', end - start));
+        if (!quote)
+            fail("unterminated string");
+        if (!std::memchr(start, '\\', quote - start)) {
+            pos = quote + 1 - buf.data();
+            return std::string_view(start, quote);
+        }
+
+        std::string &out = parser.json_strings.emplace_back();
+        for (;;) {
+            if (pos >= buf.size())
+                fail("unterminated string");
+            char c = buf[pos++];
+            if (c == '"')
+                break;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= buf.size())
+                fail("unterminated string");
+            switch (buf[pos++]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned cp = hex4();
+                // A high surrogate must be followed by a low one, which
+                // cannot stand alone
+                if (cp >= 0xdc00 && cp < 0xe000)
+                    fail("invalid surrogate pair");
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    if (!buf.substr(pos).starts_with("\\u"))
+                        fail("invalid surrogate pair");
+                    pos += 2;
+                    unsigned lo = hex4();
+                    if (lo < 0xdc00 || lo >= 0xe000)
+                        fail("invalid surrogate pair");
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                }
+                if (cp < 0x80) {
+                    out += char(cp);
+                } else if (cp < 0x800) {
+                    out += char(0xc0 | cp >> 6);
+                    out += char(0x80 | (cp & 0x3f));
+                } else if (cp < 0x10000) {
+                    out += char(0xe0 | cp >> 12);
+                    out += char(0x80 | (cp >> 6 & 0x3f));
+                    out += char(0x80 | (cp & 0x3f));
+                } else {
+                    out += char(0xf0 | cp >> 18);
+                    out += char(0x80 | (cp >> 12 & 0x3f));
+                    out += char(0x80 | (cp >> 6 & 0x3f));
+                    out += char(0x80 | (cp & 0x3f));
                 }
+                break;
+            }
+            default:
+                fail("invalid escape");
             }
         }
+        return out;
+    }
+
+    // Length of the JSON number at the start of s, 0 if there is none:
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    static size_t number(std::string_view s)
+    {
+        size_t i = 0;
+        auto digits = [&s, &i]() {
+            size_t start = i;
+            while (i < s.size() && s[i] >= '0' && s[i] <= '9')
+                i++;
+            return i > start;
+        };
+
+        if (i < s.size() && s[i] == '-')
+            i++;
+        if (i < s.size() && s[i] == '0')
+            i++;
+        else if (!digits())
+            return 0;
+        if (i < s.size() && s[i] == '.') {
+            i++;
+            if (!digits())
+                return 0;
+        }
+        if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+            i++;
+            if (i < s.size() && (s[i] == '+' || s[i] == '-'))
+                i++;
+            if (!digits())
+                return 0;
+        }
+        return i;
+    }
+
+    void object()
+    {
+        expect('{');
+        if (++depth > max_json_depth)
+            fail("nesting too deep");
+        if (eat('}')) {
+            depth--;
+            return;
+        }
+        do {
+            if (!peek('"'))
+                fail("expected member name");
+            auto key = string();
+
+            size_t len = name.size();
+            if (len)
+                name += '.';
+            name += key;
+            expect(':');
+            member();
+            name.resize(len);
+        } while (eat(','));
+        expect('}');
+        depth--;
+    }
+
+    void member()
+    {
+        if (peek('{')) {
+            object();
+        } else if (eat('[')) {
+            if (eat(']'))
+                return;
+            do {
+                if (peek('{') || peek('['))
+                    fail("nested value in array");
+                scalar();
+            } while (eat(','));
+            expect(']');
+        } else {
+            scalar();
+        }
+    }
+
+    void scalar()
+    {
+        skip_ws();
+
+        Flag *spec = parser.find_long(name);
+        if (!spec && parser.is_removed(name))
+            fail("option '" + name + "' is not available in this build");
+        if (!spec)
+            fail("unknown option: '" + name + "'");
+
+        std::string_view rest = buf.substr(pos);
+        std::string_view value;
+        bool is_bool = false;
+        if (rest.starts_with('"')) {
+            value = string();
+        } else if (rest.starts_with("true") || rest.starts_with("false")) {
+            value = rest.substr(0, rest[0] == 't' ? 4 : 5);
+            is_bool = true;
+            pos += value.size();
+        } else if (rest.starts_with("null")) {
+            pos += 4;
+            return;
+        } else {
+            // Checked whole, or "1.2.3" would pass on "1.2" before failing
+            value = rest.substr(0, number(rest));
+            if (value.empty() || rest.substr(value.size()).find_first_of("+-.0123456789eE") == 0)
+                fail("invalid value");
+            pos += value.size();
+        }
+
+        if (spec->expects_value) {
+            if (value.empty())
+                fail("option '" + name + "' requires an argument");
+            spec->action(value);
+        } else if (!is_bool) {
+            fail("option '" + name + "' does not take a value");
+        } else if (value == "true") {
+            spec->action(std::string_view());
+        }
     }
+};
+
+void Parser::parse_json(std::string_view json)
+{
+    json_strings.clear();
+    JsonReader reader{*this, json, 0, std::string(), 0};
+
+    reader.object();
+    reader.skip_ws();
+    if (reader.pos != json.size())
+        reader.fail("trailing characters");
+
+    finish();
 }
 
-void Parser::print_help_page(std::string_view usage)
+void Parser::print_help_page(std::string_view usage, std::string_view pattern, std::string_view section)
 {
     const size_t lhs_max = 32;
 
-    std::cout << "Usage: " << usage << '\n';
-    for (const auto &f : flags) {
-        std::stringstream lhs;
-        lhs << "  ";
+    if (!section.empty() && std::none_of(sections.begin(), sections.end(), [section](const auto &s){
+                return s.second == section;
+                })) {
+        std::cerr << progname << ": unknown help section: '" << section << "'\n";
+        std::exit(1);
+    }
+
+    std::cout << "Usage: ";
+    if (usage.empty()) {
+        std::cout << progname.substr(progname.rfind('/') + 1) << " [OPTIONS]";
+        for (const auto &p : slots) {
+            std::cout << ' ' << (p.min == 0 ? "[" : "") << p.name << (p.max > 1 ? "..." : "")
+                      << (p.min == 0 ? "]" : "");
+        }
+        std::cout << '\n';
+    } else {
+        std::cout << usage << '\n';
+    }
+
+    auto next_section = sections.begin();
+    std::string_view current;
+    // Printed before the first flag of the section that is shown
+    bool header = false;
+    for (size_t i = 0; i < flags.size(); i++) {
+        const auto &f = flags[i];
+
+        for (; next_section != sections.end() && next_section->first == i; next_section++) {
+            current = next_section->second;
+            header = true;
+        }
+
+        if (f.hidden || (!section.empty() && current != section))
+            continue;
+        if (!pattern.empty() && !f.long_name.contains(pattern) && !f.description.contains(pattern))
+            continue;
+
+        if (header && pattern.empty()) {
+            std::cout << '\n';
+            if (!current.empty())
+                std::cout << current << ":\n";
+        }
+        header = false;
+
+        std::string lhs = "  ";
         if (f.short_name)
-            lhs << "-" << f.short_name;
+            lhs += {'-', f.short_name};
         if (f.short_name != '\0' && !f.long_name.empty())
-            lhs << ", ";
+            lhs += ", ";
         if (f.long_name.size())
-            lhs << "--" << f.long_name;
+            lhs.append("--").append(f.long_name);
 
         if (f.expects_value)
-            lhs << " ARG";
+            lhs += " ARG";
     
-        if (lhs.str().size() <= lhs_max) {
-            std::cout << lhs.str() << std::string(lhs_max - lhs.str().size(), ' ') << " " << f.description << '\n';
+        if (lhs.size() <= lhs_max) {
+            std::cout << lhs << std::string(lhs_max - lhs.size(), ' ') << " " << f.description << '\n';
         } else {
-            std::cout << lhs.str() << '\n' << std::string(lhs_max, ' ') << " " << f.description << '\n';
+            std::cout << lhs << '\n' << std::string(lhs_max, ' ') << " " << f.description << '\n';
         }
     }
 }